@@ -1,3 +1,8 @@
+// mmap(), realpath() and clock_gettime() used by the optional parts are not part of C99
+#if defined(INI_READER_CACHE) || defined(INI_READER_PROFILE)
+   #define _XOPEN_SOURCE 700
+#endif
+
 #include "ini-reader.h"
 
 // local includes
@@ -5,11 +10,37 @@
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#ifdef INI_READER_CACHE
+   #include <fcntl.h>
+   #include <unistd.h>
+   #include <sys/types.h>
+   #include <sys/stat.h>
+   #include <sys/mman.h>
+#endif
+#ifdef INI_READER_PROFILE
+   #include <time.h>
+   #include <pthread.h>
+#endif
 
 #ifndef INI_READER_STRLEN
    #define INI_READER_STRLEN  256
 #endif
 
+#ifdef INI_READER_CACHE
+// identification of cached images, version changes with their layout
+#define INI_READER_IMAGE_MAGIC     "INIRDIMG"
+#define INI_READER_IMAGE_VERSION   2
+#endif
+
+// number of distinct properties profiled per thread, power of two
+#ifndef INI_READER_PROFILE_SLOTS
+   #define INI_READER_PROFILE_SLOTS  256
+#endif
+
 // general descriptions of error states
 struct _error_descriptions{
    int         code;
@@ -23,31 +54,178 @@ struct _error_descriptions{
    , { E_INI_READER_DUPLICATE_PROPERTY, "there are multiple properties with identical names in this section" }
    , { E_INI_READER_SECTION_NOT_FOUND, "no such section" }
    , { E_INI_READER_PROPERTY_NOT_FOUND, "no such property in this saction" }
+   , { E_INI_READER_SCHEMA_VIOLATION, "config data does not match the schema" }
+   , { E_INI_READER_REFERENCE_NOT_FOUND, "referenced property or environment variable not found" }
+   , { E_INI_READER_REFERENCE_CYCLE, "properties reference each other in a cycle" }
+};
+
+// state of reference expansion in a property value
+enum _t_ini_reader_expansion
+   { EXPANSION_PENDING     // value contains references, not expanded yet
+   , EXPANSION_ACTIVE      // expansion in progress, reaching it again is a cycle
+   , EXPANSION_DONE        // expanded value (or the plain value) is final
+   , EXPANSION_FAILED      // expansion failed, expanded holds the error details
 };
 
 // linked list to store config file properties
 typedef struct _t_ini_reader_property * t_ini_reader_property;
 struct _t_ini_reader_property {
    t_ini_reader_property   next;
-   char                    key[INI_READER_STRLEN];
-   char                    value[INI_READER_STRLEN];
+   const char             *key;          // points into the source buffer
+   const char             *value;        // points into the source buffer, unless value_owned
+   int                     value_owned;
+   char                   *expanded;     // memoized value with references expanded
+   enum _t_ini_reader_expansion expansion;
+   ini_reader_error_code   expansion_error;
+   int                     line;
 };
 
 // linked list to store config file sections
 typedef struct _t_ini_reader_section * t_ini_reader_section;
 struct _t_ini_reader_section {
    t_ini_reader_section next;
-   char                 key[INI_READER_STRLEN];
+   const char          *key;            // points into the source buffer
    t_ini_reader_property       properties;
+   t_ini_reader_property       last_property;
+   int                  line;
 };
 
 // parent structure
 struct _ini_reader_data {
    t_ini_reader_section    head_section;
+   t_ini_reader_section    last_section;
+   char                   *buffer;         // source text, holds keys and undecoded values
+#ifdef INI_READER_CACHE
+   void                   *image;          // mapped cache image, holds all strings if not NULL
+   size_t                  image_size;
+#endif
    ini_reader_error_code   last_error_code;
    char                    last_error_details[INI_READER_STRLEN];
+   char                   *filename;
+};
+
+// result of decoding a single value from the source
+struct _t_ini_reader_value {
+   const char *start;      // first character of the value in the source
+   size_t      length;     // length of the decoded value
+   size_t      size;       // space needed to decode it, including trailing whitespace
+   int         copy;       // decoded value differs from the source and has to be copied
+   int         lines;      // number of lines the value spans
+   const char *next;       // start of the next line to parse
+   const char *error;      // description of a parse error, NULL on success
+};
+
+#ifdef INI_READER_CACHE
+// header of a cached image, followed by sections, properties and strings,
+// string offsets are relative to the start of strings, canonical source path is the first string
+typedef struct _t_ini_reader_image_header * t_ini_reader_image_header;
+struct _t_ini_reader_image_header {
+   char        magic[8];
+   uint32_t    version;
+   uint32_t    reserved;
+   uint64_t    source_device;
+   uint64_t    source_inode;
+   uint64_t    source_size;
+   int64_t     source_mtime_sec;
+   int64_t     source_mtime_nsec;
+   uint64_t    source_hash;      // hash of the source text
+   uint64_t    image_hash;       // hash of everything following the header
+   uint64_t    image_size;
+   uint64_t    strings_size;
+   uint32_t    section_count;
+   uint32_t    property_count;
+};
+
+// cached section, its properties are stored consecutively
+typedef struct _t_ini_reader_image_section * t_ini_reader_image_section;
+struct _t_ini_reader_image_section {
+   uint32_t    name;
+   uint32_t    first_property;
+   uint32_t    property_count;
+   int32_t     line;
+};
+
+// cached property, value is decoded but references are not expanded
+typedef struct _t_ini_reader_image_property * t_ini_reader_image_property;
+struct _t_ini_reader_image_property {
+   uint32_t    key;
+   uint32_t    value;
+   int32_t     line;
+   uint32_t    reserved;
+};
+
+// cache directory, NULL if caching is disabled
+char *cache_directory = NULL;
+
+// cache statistics, updated atomically
+ini_reader_cache_stats cache_stats = { 0, 0, 0, 0, 0, 0 };
+#endif
+
+// compiled schema entry, default value is converted in advance
+typedef struct _t_ini_reader_plan_entry * t_ini_reader_plan_entry;
+struct _t_ini_reader_plan_entry {
+   ini_reader_schema_entry entry;
+   int                     default_int;
+   double                  default_double;
 };
 
+// compiled schema section, a range of entries sharing the section name
+typedef struct _t_ini_reader_plan_section * t_ini_reader_plan_section;
+struct _t_ini_reader_plan_section {
+   const char *name;
+   size_t      first;
+   size_t      count;
+};
+
+// compiled schema, entries sorted by section and key
+struct _ini_reader_schema {
+   struct _t_ini_reader_plan_entry    *entries;
+   size_t                              entry_count;
+   struct _t_ini_reader_plan_section  *sections;
+   size_t                              section_count;
+};
+
+#ifdef INI_READER_PROFILE
+// access counters of a single (section, key) pair,
+// written only by the owning thread, read by reports
+typedef struct _t_ini_reader_profile_slot * t_ini_reader_profile_slot;
+struct _t_ini_reader_profile_slot {
+   char                 *section;
+   char                 *key;
+   unsigned long         hash;
+   unsigned long         accesses;
+   unsigned long         misses;
+   unsigned long long    nanoseconds;
+   int                   used;       // set once section and key are filled in
+};
+
+// per-thread counter table, linked into a global list that is never shrunk,
+// tables of exited threads are handed to new threads with their counters
+typedef struct _t_ini_reader_profile_buffer * t_ini_reader_profile_buffer;
+struct _t_ini_reader_profile_buffer {
+   t_ini_reader_profile_buffer         next;
+   int                                 in_use;     // owned by a running thread
+   unsigned long                       epoch;      // counters are valid for this reset epoch
+   unsigned long                       dropped;    // lookups not recorded, table full
+   struct _t_ini_reader_profile_slot   slots[INI_READER_PROFILE_SLOTS];
+};
+
+// all per-thread buffers, and the one of the current thread
+t_ini_reader_profile_buffer profile_buffers = NULL;
+__thread t_ini_reader_profile_buffer profile_thread_buffer = NULL;
+
+// releases the buffer of a thread when it exits
+pthread_key_t profile_thread_key;
+pthread_once_t profile_thread_key_once = PTHREAD_ONCE_INIT;
+
+// incremented by resets, buffers of older epochs count as empty
+unsigned long profile_epoch = 0;
+
+// destination of the report printed at exit, NULL prints nothing
+FILE *profile_exit_report = NULL;
+int profile_exit_registered = 0;
+#endif
+
 // linked list handling
 void add_section( ini_reader_data    parent
                 , t_ini_reader_section new );
@@ -60,21 +238,117 @@ void add_property( t_ini_reader_section   parent
 t_ini_reader_property get_property( t_ini_reader_section  parent
                            , const char           *key );
 t_ini_reader_property new_property( const char *key
-                           , const char *value );
+                           , const char *value
+                           , int         value_owned );
 void clear_properties( t_ini_reader_section parent );
 
 // utility functions
 void strncpy_fixed( char        *dest
                   , const char  *src
                   , size_t       count );
-void trim_edge_whitespace( char *str );
+char *copy_string( const char *str );
+void append_string( char        **dest
+                  , size_t       *length
+                  , size_t       *capacity
+                  , const char   *src
+                  , size_t        count );
+char *read_file( FILE    *fp
+               , size_t  *size );
 void set_last_error( ini_reader_data         ini_data
                    , ini_reader_error_code   errcode
                    , const char             *message );
 void append_last_error( ini_reader_data   ini_data
                        , const char      *message );
 
+// parsed-config cache
+#ifdef INI_READER_CACHE
+uint64_t hash_bytes( const void  *data
+                   , size_t       size );
+char *cache_image_path( const char *canonical );
+int load_cached_image( ini_reader_data   data
+                     , const char       *filename );
+void write_cached_image( ini_reader_data      data
+                       , const struct stat   *source
+                       , uint64_t             source_hash );
+#endif
+
+// value decoding
+int is_blank( char c );
+char escaped_char( char c );
+const char *skip_line_break( const char *p
+                           , const char *end );
+const char *decode_plain( const char                   *p
+                        , const char                   *end
+                        , char                         *out
+                        , struct _t_ini_reader_value   *value );
+const char *decode_quoted( const char                   *p
+                         , const char                   *end
+                         , char                         *out
+                         , struct _t_ini_reader_value   *value );
+int starts_entry( const char *p
+                , const char *end );
+int decode_value( const char                   *p
+                , const char                   *end
+                , size_t                        key_indent
+                , char                         *out
+                , struct _t_ini_reader_value   *value );
+
+// schema handling
+int compare_plan_entries( const void *a
+                        , const void *b );
+t_ini_reader_plan_section find_plan_section( ini_reader_schema  schema
+                                           , const char        *name );
+t_ini_reader_plan_entry find_plan_entry( ini_reader_schema           schema
+                                       , t_ini_reader_plan_section   section
+                                       , const char                 *key );
+int convert_value( const char        *str
+                 , ini_reader_type    type
+                 , int               *int_value
+                 , double            *double_value );
+void store_value( void                     *target
+                , t_ini_reader_plan_entry   plan_entry
+                , const char               *str
+                , int                       int_value
+                , double                    double_value );
+void report_violation( ini_reader_data   ini_data
+                     , FILE             *report
+                     , char             *first
+                     , int               violations
+                     , int               line
+                     , const char       *message );
+
+#ifdef INI_READER_PROFILE
+// lookup profiling
+unsigned long profile_hash( const char *section
+                          , const char *key );
+void profile_create_thread_key( void );
+void profile_release_thread_buffer( void *buffer );
+t_ini_reader_profile_buffer profile_get_thread_buffer( void );
+void profile_record( const char               *section
+                   , const char               *key
+                   , int                       miss
+                   , const struct timespec    *start
+                   , const struct timespec    *stop );
+int profile_compare_names( const void *a
+                         , const void *b );
+int profile_compare_accesses( const void *a
+                            , const void *b );
+void profile_report_at_exit( void );
+#endif
+
+// reference expansion
+void expand_references( ini_reader_data ini_data );
+const char *resolve_value( ini_reader_data         ini_data
+                         , t_ini_reader_section    section
+                         , t_ini_reader_property   property );
+char *expand_value( ini_reader_data         ini_data
+                  , t_ini_reader_section    section
+                  , t_ini_reader_property   property );
+
 // basic getter
+const char *lookup_value( ini_reader_data  ini_data
+                        , const char      *section
+                        , const char      *key );
 const char *ini_reader_get_basic( ini_reader_data  ini_data
                                 , const char      *section
                                 , const char      *key );
@@ -90,25 +364,614 @@ void strncpy_fixed
    dest[count-1] = '\0';
 }
 
+char *copy_string
+   ( const char *str
+){
+   size_t len = strlen( str ) + 1;
+   char *copy = (char *)malloc( len );
+
+   memcpy( copy, str, len );
+   return copy;
+}
+
+void append_string
+   ( char        **dest
+   , size_t       *length
+   , size_t       *capacity
+   , const char   *src
+   , size_t        count
+){
+   // grow the destination as needed, keep it terminated
+   if( *length + count + 1 > *capacity ){
+      while( *length + count + 1 > *capacity )
+         *capacity *= 2;
+      *dest = (char *)realloc( *dest, *capacity );
+   }
+   memcpy( *dest + *length, src, count );
+   *length += count;
+   (*dest)[*length] = '\0';
+}
+
+
+char *read_file
+   ( FILE    *fp
+   , size_t  *size
+){
+   size_t capacity = 4096;
+   size_t n;
+   char *buffer = (char *)malloc( capacity );
+
+   // read in chunks, doubling the buffer as needed
+   *size = 0;
+   while( (n = fread( buffer + *size, 1, capacity - *size - 1, fp )) > 0 ){
+      *size += n;
+      if( *size + 1 == capacity ){
+         capacity *= 2;
+         buffer = (char *)realloc( buffer, capacity );
+      }
+   }
+   buffer[*size] = '\0';
+
+   return buffer;
+}
+
+#ifdef INI_READER_CACHE
+uint64_t hash_bytes
+   ( const void  *data
+   , size_t       size
+){
+   // 64-bit FNV-1a
+   const unsigned char *p = (const unsigned char *)data;
+   uint64_t hash = 14695981039346656037ULL;
+
+   while( size-- )
+      hash = (hash ^ *p++) * 1099511628211ULL;
+
+   return hash;
+}
+
+char *cache_image_path
+   ( const char *canonical
+){
+   size_t len = strlen( cache_directory ) + 32;
+   char *path = (char *)malloc( len );
+
+   // images are named after the hash of the canonical source path
+   snprintf( path, len, "%s/%016llx.ini-cache", cache_directory
+           , (unsigned long long)hash_bytes( canonical, strlen( canonical ) ) );
+   return path;
+}
+
+int load_cached_image
+   ( ini_reader_data   data
+   , const char       *filename
+){
+   struct stat source, st;
+   t_ini_reader_image_header    header;
+   t_ini_reader_image_section   sections;
+   t_ini_reader_image_property  properties;
+   t_ini_reader_section  section;
+   t_ini_reader_property property;
+   const char *strings;
+   char *canonical;
+   char *path;
+   char *text;
+   void *map;
+   size_t size, text_size, i, j;
+   uint64_t tables, strings_size;
+   FILE *fp;
+   int fd, same;
+
+   // images are keyed by the canonical path, unresolvable files are parsed as usual
+   canonical = realpath( filename, NULL );
+   if( !canonical )
+      return -1;
+   if( stat( canonical, &source ) != 0 ){
+      free( canonical );
+      return -1;
+   }
+
+   /// Map the image, missing image is a plain miss
+   path = cache_image_path( canonical );
+   fd = open( path, O_RDONLY );
+   free( path );
+   if( fd < 0 ){
+      free( canonical );
+      __atomic_fetch_add( &cache_stats.misses, 1, __ATOMIC_RELAXED );
+      return -1;
+   }
+   if( fstat( fd, &st ) != 0 || (size_t)st.st_size < sizeof(*header) ){
+      close( fd );
+      goto corrupt_unmapped;
+   }
+   size = (size_t)st.st_size;
+   map = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+   close( fd );
+   if( map == MAP_FAILED )
+      goto corrupt_unmapped;
+
+   /// Check the image itself, nothing past the header is read before its hash matches
+   header = (t_ini_reader_image_header)map;
+   if( memcmp( header->magic, INI_READER_IMAGE_MAGIC, sizeof(header->magic) ) != 0
+    || header->version != INI_READER_IMAGE_VERSION
+    || header->image_size != size )
+      goto corrupt;
+
+   // counts are 32-bit, so the table size cannot overflow
+   tables = (uint64_t)header->section_count * sizeof(*sections)
+          + (uint64_t)header->property_count * sizeof(*properties);
+   if( tables > size - sizeof(*header) )
+      goto corrupt;
+   strings_size = size - sizeof(*header) - tables;
+   if( strings_size == 0 || header->strings_size != strings_size )
+      goto corrupt;
+   if( header->image_hash != hash_bytes( header + 1, size - sizeof(*header) ) )
+      goto corrupt;
+
+   sections   = (t_ini_reader_image_section)(header + 1);
+   properties = (t_ini_reader_image_property)(sections + header->section_count);
+   strings    = (const char *)(properties + header->property_count);
+   if( strings[strings_size-1] != '\0' )
+      goto corrupt;
+
+   // every offset has to stay inside the image
+   for( i = 0; i < header->section_count; i++ ){
+      if( sections[i].name >= strings_size
+       || sections[i].first_property > header->property_count
+       || sections[i].property_count > header->property_count - sections[i].first_property )
+         goto corrupt;
+   }
+   for( i = 0; i < header->property_count; i++ ){
+      if( properties[i].key >= strings_size || properties[i].value >= strings_size )
+         goto corrupt;
+   }
+
+   /// Check the image against the source, contents are always compared
+   if( strcmp( strings, canonical ) != 0
+    || header->source_device != (uint64_t)source.st_dev
+    || header->source_inode != (uint64_t)source.st_ino
+    || header->source_size != (uint64_t)source.st_size
+    || header->source_mtime_sec != (int64_t)source.st_mtim.tv_sec
+    || header->source_mtime_nsec != (int64_t)source.st_mtim.tv_nsec )
+      goto stale;
+
+   fp = fopen( canonical, "rb" );
+   if( !fp )
+      goto stale;
+   text = read_file( fp, &text_size );
+   fclose( fp );
+   same = text_size == header->source_size && header->source_hash == hash_bytes( text, text_size );
+   free( text );
+   if( !same )
+      goto stale;
+
+   /// Rebuild sections and properties, strings stay in the mapped image
+   for( i = 0; i < header->section_count; i++ ){
+      section = new_section( strings + sections[i].name );
+      section->line = sections[i].line;
+      add_section( data, section );
+      for( j = sections[i].first_property; j < sections[i].first_property + sections[i].property_count; j++ ){
+         property = new_property( strings + properties[j].key, strings + properties[j].value, 0 );
+         property->line = properties[j].line;
+         add_property( section, property );
+      }
+   }
+   data->image = map;
+   data->image_size = size;
+
+   free( canonical );
+   __atomic_fetch_add( &cache_stats.hits, 1, __ATOMIC_RELAXED );
+   return 0;
+
+stale:
+   munmap( map, size );
+   free( canonical );
+   __atomic_fetch_add( &cache_stats.stale, 1, __ATOMIC_RELAXED );
+   __atomic_fetch_add( &cache_stats.misses, 1, __ATOMIC_RELAXED );
+   return -1;
+
+corrupt:
+   munmap( map, size );
+corrupt_unmapped:
+   free( canonical );
+   __atomic_fetch_add( &cache_stats.corrupt, 1, __ATOMIC_RELAXED );
+   __atomic_fetch_add( &cache_stats.misses, 1, __ATOMIC_RELAXED );
+   return -1;
+}
+
+void write_cached_image
+   ( ini_reader_data      data
+   , const struct stat   *source
+   , uint64_t             source_hash
+){
+   struct _t_ini_reader_image_header header;
+   t_ini_reader_image_section   sections;
+   t_ini_reader_image_property  properties;
+   t_ini_reader_section  s;
+   t_ini_reader_property p;
+   uint64_t strings_size, offset;
+   uint32_t section_count = 0, property_count = 0;
+   size_t size, written, len;
+   char *image, *strings, *canonical, *path, *temp;
+   ssize_t n;
+   int fd;
+
+   canonical = realpath( data->filename, NULL );
+   if( !canonical )
+      goto failed;
+
+   /// Measure the image
+   strings_size = strlen( canonical ) + 1;
+   for( s = data->head_section; s; s = s->next ){
+      section_count++;
+      strings_size += strlen( s->key ) + 1;
+      for( p = s->properties; p; p = p->next ){
+         property_count++;
+         strings_size += strlen( p->key ) + 1 + strlen( p->value ) + 1;
+      }
+   }
+   if( strings_size > UINT32_MAX ){
+      free( canonical );
+      goto failed;
+   }
+
+   memset( &header, 0, sizeof(header) );
+   memcpy( header.magic, INI_READER_IMAGE_MAGIC, sizeof(header.magic) );
+   header.version           = INI_READER_IMAGE_VERSION;
+   header.source_device     = (uint64_t)source->st_dev;
+   header.source_inode      = (uint64_t)source->st_ino;
+   header.source_size       = (uint64_t)source->st_size;
+   header.source_mtime_sec  = (int64_t)source->st_mtim.tv_sec;
+   header.source_mtime_nsec = (int64_t)source->st_mtim.tv_nsec;
+   header.source_hash       = source_hash;
+   header.strings_size      = strings_size;
+   header.section_count     = section_count;
+   header.property_count    = property_count;
+   size = sizeof(header) + section_count * sizeof(*sections)
+        + property_count * sizeof(*properties) + strings_size;
+   header.image_size        = size;
+
+   /// Fill in sections, properties and strings
+   image = (char *)calloc( 1, size );
+   sections   = (t_ini_reader_image_section)(image + sizeof(header));
+   properties = (t_ini_reader_image_property)(sections + section_count);
+   strings    = (char *)(properties + property_count);
+
+   len = strlen( canonical ) + 1;
+   memcpy( strings, canonical, len );
+   offset = len;
+   property_count = 0;
+   for( s = data->head_section; s; s = s->next, sections++ ){
+      len = strlen( s->key ) + 1;
+      memcpy( strings + offset, s->key, len );
+      sections->name           = (uint32_t)offset;
+      sections->first_property = property_count;
+      sections->property_count = 0;
+      sections->line           = s->line;
+      offset += len;
+      for( p = s->properties; p; p = p->next, properties++ ){
+         len = strlen( p->key ) + 1;
+         memcpy( strings + offset, p->key, len );
+         properties->key = (uint32_t)offset;
+         offset += len;
+         len = strlen( p->value ) + 1;
+         memcpy( strings + offset, p->value, len );
+         properties->value = (uint32_t)offset;
+         offset += len;
+         properties->line = p->line;
+         sections->property_count++;
+         property_count++;
+      }
+   }
+   header.image_hash = hash_bytes( image + sizeof(header), size - sizeof(header) );
+   memcpy( image, &header, sizeof(header) );
+
+   /// Write to a unique temporary file, then rename it over the image
+   path = cache_image_path( canonical );
+   free( canonical );
+   len = strlen( path ) + 8;
+   temp = (char *)malloc( len );
+   snprintf( temp, len, "%s.XXXXXX", path );
+
+   fd = mkstemp( temp );
+   written = 0;
+   if( fd >= 0 ){
+      fchmod( fd, 0644 );
+      while( written < size && (n = write( fd, image + written, size - written )) > 0 )
+         written += (size_t)n;
+      if( close( fd ) != 0 )
+         written = 0;
+   }
+   if( fd < 0 || written != size || rename( temp, path ) != 0 ){
+      if( fd >= 0 )
+         unlink( temp );
+      free( image );
+      free( path );
+      free( temp );
+      goto failed;
+   }
+
+   free( image );
+   free( path );
+   free( temp );
+   __atomic_fetch_add( &cache_stats.writes, 1, __ATOMIC_RELAXED );
+   return;
+
+failed:
+   __atomic_fetch_add( &cache_stats.write_failures, 1, __ATOMIC_RELAXED );
+}
+
+void ini_reader_set_cache_directory
+   ( const char *directory
+){
+   free( cache_directory );
+   cache_directory = directory ? copy_string( directory ) : NULL;
+}
+
+void ini_reader_get_cache_stats
+   ( ini_reader_cache_stats *stats
+){
+   stats->hits           = __atomic_load_n( &cache_stats.hits, __ATOMIC_RELAXED );
+   stats->misses         = __atomic_load_n( &cache_stats.misses, __ATOMIC_RELAXED );
+   stats->stale          = __atomic_load_n( &cache_stats.stale, __ATOMIC_RELAXED );
+   stats->corrupt        = __atomic_load_n( &cache_stats.corrupt, __ATOMIC_RELAXED );
+   stats->writes         = __atomic_load_n( &cache_stats.writes, __ATOMIC_RELAXED );
+   stats->write_failures = __atomic_load_n( &cache_stats.write_failures, __ATOMIC_RELAXED );
+}
+#endif
+
+int is_blank
+   ( char c
+){
+   return c == ' ' || c == '\t' || c == '\r';
+}
+
+char escaped_char
+   ( char c
+){
+   switch( c ){
+   case 'n':  return '\n';
+   case 't':  return '\t';
+   case 'r':  return '\r';
+   case '\\': return '\\';
+   case '"':  return '"';
+   case '\'': return '\'';
+   case ';':  return ';';
+   case '#':  return '#';
+   default:   return 0;
+   }
+}
+
+const char *skip_line_break
+   ( const char *p
+   , const char *end
+){
+   // return the start of the next line if p is at a line break, NULL otherwise
+   if( p < end && *p == '\r' && p+1 < end && p[1] == '\n' )
+      return p+2;
+   if( p < end && *p == '\n' )
+      return p+1;
+   return NULL;
+}
 
-void trim_edge_whitespace
-   ( char *str
+const char *decode_plain
+   ( const char                   *p
+   , const char                   *end
+   , char                         *out
+   , struct _t_ini_reader_value   *value
 ){
-   char *first = str;
-   char *last  = str + strlen(str) - 1;
+   size_t significant = value->length;
+   int after_blank = 1;
+   const char *after;
+   char c;
+
+   while( p < end && *p != '\n' ){
+      // inline comment, if at the start of the value or after whitespace
+      if( (*p == ';' || *p == '#') && after_blank ){
+         while( p < end && *p != '\n' )
+            p++;
+         break;
+      }
+
+      if( *p == '\\' ){
+         // backslash continuation, join with the next line unless it starts a section
+         after = skip_line_break( p+1, end );
+         while( after && after < end && is_blank(*after) )
+            after++;
+         if( after && (after == end || *after != '[') ){
+            p = after;
+            value->copy = 1;
+            value->lines++;
+            continue;
+         }
+         // only comment characters are escaped, other backslashes are kept as they are
+         c = p+1 < end && (p[1] == ';' || p[1] == '#') ? p[1] : 0;
+         if( c ){
+            if( out )
+               out[value->length] = c;
+            value->length++;
+            significant = value->length;
+            after_blank = 0;
+            value->copy = 1;
+            p += 2;
+            continue;
+         }
+      }
+
+      if( out )
+         out[value->length] = *p;
+      value->length++;
+      after_blank = isspace( (unsigned char)*p );
+      if( !after_blank )
+         significant = value->length;
+      p++;
+   }
+
+   // drop trailing whitespace
+   if( value->length > value->size )
+      value->size = value->length;
+   value->length = significant;
+   return p;
+}
+
+const char *decode_quoted
+   ( const char                   *p
+   , const char                   *end
+   , char                         *out
+   , struct _t_ini_reader_value   *value
+){
+   const char *after;
+   char c;
+
+   while( p < end && *p != '\n' ){
+      if( *p == '"' ){
+         value->size = value->length;
+         return p+1;
+      }
+
+      if( *p == '\\' ){
+         // backslash continuation, join with the next line
+         after = skip_line_break( p+1, end );
+         if( after ){
+            p = after;
+            while( p < end && is_blank(*p) )
+               p++;
+            value->copy = 1;
+            value->lines++;
+            continue;
+         }
+         // escape sequence, unknown ones are kept as they are
+         c = p+1 < end ? escaped_char( p[1] ) : 0;
+         if( c ){
+            if( out )
+               out[value->length] = c;
+            value->length++;
+            value->copy = 1;
+            p += 2;
+            continue;
+         }
+      }
+
+      if( out )
+         out[value->length] = *p;
+      value->length++;
+      p++;
+   }
+
+   // closing quote not found
+   return NULL;
+}
+
+int starts_entry
+   ( const char *p
+   , const char *end
+){
+   int key_only_base64 = 1;
+
+   // section
+   if( p < end && *p == '[' )
+      return 1;
+   if( p == end || !isalnum( (unsigned char)*p ) )
+      return 0;
+
+   // property, unless it can be a line of base64 data ("AB+/cd==")
+   while( p < end && *p != '\n' && *p != '=' ){
+      if( !isalnum( (unsigned char)*p ) && *p != '+' && *p != '/' )
+         key_only_base64 = 0;
+      p++;
+   }
+   if( p == end || *p == '\n' )
+      return 0;
+   if( !key_only_base64 )
+      return 1;
+   while( p < end && (*p == '=' || is_blank(*p)) )
+      p++;
+   return p < end && *p != '\n';
+}
+
+int decode_value
+   ( const char                   *p
+   , const char                   *end
+   , size_t                        key_indent
+   , char                         *out
+   , struct _t_ini_reader_value   *value
+){
+   const char *line;
+   const char *content;
+   int block = 0;
+
+   value->length = 0;
+   value->size   = 0;
+   value->copy   = 0;
+   value->lines  = 1;
+   value->error  = NULL;
+
+   while( p < end && is_blank(*p) )
+      p++;
+   value->start = p;
+
+   /// Quoted value, only whitespace and a comment may follow it
+   if( p < end && *p == '"' ){
+      value->start = p+1;
+      p = decode_quoted( p+1, end, out, value );
+      if( !p ){
+         value->error = "Unterminated quoted value.";
+         return -1;
+      }
+      while( p < end && is_blank(*p) )
+         p++;
+      if( p < end && *p != '\n' && *p != ';' && *p != '#' ){
+         value->error = "Unexpected characters after quoted value.";
+         return -1;
+      }
+      while( p < end && *p != '\n' )
+         p++;
+      value->next = p < end ? p+1 : end;
+      return 0;
+   }
 
-   while( *first && isspace(*first) )
-      first++;
-   while( last > first && isspace(*last) )
-      last--;
-   last[1] = '\0';
+   /// Plain value
+   p = decode_plain( p, end, out, value );
+   value->next = p < end ? p+1 : end;
+
+   /// Empty plain value followed by lines indented deeper than the key
+   /// is a block value, lines are joined with newlines,
+   /// a line that looks like a property or a section ends the block
+   if( value->length == 0 && value->lines == 1 ){
+      line = value->next;
+      while( line < end ){
+         content = line;
+         while( content < end && is_blank(*content) )
+            content++;
+         if( (size_t)(content - line) <= key_indent || content == end || *content == '\n'
+          || starts_entry( content, end ) )
+            break;
+
+         // comment lines inside the block are skipped
+         if( *content != ';' && *content != '#' ){
+            if( block ){
+               if( out )
+                  out[value->length] = '\n';
+               value->length++;
+               if( value->length > value->size )
+                  value->size = value->length;
+            }
+            block = 1;
+            value->copy = 1;
+            p = decode_plain( content, end, out, value );
+         } else {
+            p = content;
+            while( p < end && *p != '\n' )
+               p++;
+         }
 
-   while( *first ) {
-      *str = *first;
-      str++;
-      first++;
+         value->lines++;
+         line = p < end ? p+1 : end;
+      }
+      value->next = line;
    }
-   *str = *first;
+
+   return 0;
 }
 
 void set_last_error
@@ -136,7 +999,9 @@ t_ini_reader_section new_section
    section = (t_ini_reader_section)malloc( sizeof(*section) );
    section->next = NULL;
    section->properties = NULL;
-   strncpy_fixed( section->key, key, INI_READER_STRLEN );
+   section->last_property = NULL;
+   section->line = 0;
+   section->key = key;
 
    return section;
 }
@@ -145,8 +1010,13 @@ void add_section
    ( ini_reader_data parent
    , t_ini_reader_section new
 ){
-   new->next = parent->head_section;
-   parent->head_section = new;
+   // append, keeping sections in file order
+   new->next = NULL;
+   if( parent->last_section )
+      parent->last_section->next = new;
+   else
+      parent->head_section = new;
+   parent->last_section = new;
 }
 
 t_ini_reader_section get_section
@@ -176,18 +1046,25 @@ void clear_sections
       s = next;
    }
    parent->head_section = NULL;
+   parent->last_section = NULL;
 }
 
 t_ini_reader_property new_property
    ( const char *key
    , const char *value
+   , int         value_owned
 ){
    t_ini_reader_property property;
 
    property = (t_ini_reader_property)malloc( sizeof(*property) );
    property->next = NULL;
-   strncpy_fixed( property->key,   key,   INI_READER_STRLEN );
-   strncpy_fixed( property->value, value, INI_READER_STRLEN );
+   property->line = 0;
+   property->key = key;
+   property->value = value;
+   property->value_owned = value_owned;
+   property->expanded = NULL;
+   property->expansion = strstr( value, "${" ) ? EXPANSION_PENDING : EXPANSION_DONE;
+   property->expansion_error = E_INI_READER_SUCCESS;
 
    return property;
 }
@@ -196,8 +1073,13 @@ void add_property
    ( t_ini_reader_section  parent
    , t_ini_reader_property new
 ){
-   new->next = parent->properties;
-   parent->properties = new;
+   // append, keeping properties in file order
+   new->next = NULL;
+   if( parent->last_property )
+      parent->last_property->next = new;
+   else
+      parent->properties = new;
+   parent->last_property = new;
 }
 
 t_ini_reader_property get_property
@@ -222,71 +1104,135 @@ void clear_properties
    t_ini_reader_property next;
    while( p ){
       next = p->next;
+      if( p->value_owned )
+         free( (char *)p->value );
+      free( p->expanded );
       free( p );
       p = next;
    }
    parent->properties = NULL;
+   parent->last_property = NULL;
 }
 
 ini_reader_data ini_reader_parse
    ( const char *filename
 ){
    FILE *fp;
-   char line[INI_READER_STRLEN];
-   char key[INI_READER_STRLEN];
-   char value[INI_READER_STRLEN];
+   size_t size;
+#ifdef INI_READER_CACHE
+   struct stat source;
+   uint64_t source_hash = 0;
+   int cacheable = 0;
+#endif
+   char *p, *end, *eol, *next, *start, *stop, *eq;
+   char *value;
+   struct _t_ini_reader_value decoded;
    ini_reader_data    data;
    t_ini_reader_section current_section;
+   t_ini_reader_property property;
    int line_number = 0;
    char error_message[INI_READER_STRLEN];
 
    /// Initialize data structures
    data = (ini_reader_data)malloc( sizeof(*data) );
    set_last_error( data, E_INI_READER_SUCCESS, "" );
+   data->filename = copy_string( filename );
+
+   data->head_section = NULL;
+   data->last_section = NULL;
+   data->buffer = NULL;
+
+#ifdef INI_READER_CACHE
+   data->image = NULL;
+   data->image_size = 0;
+
+   /// Use the cached image if it is still valid
+   if( cache_directory && load_cached_image( data, filename ) == 0 ){
+      expand_references( data );
+      return data;
+   }
+#endif
 
-   data->head_section = new_section( "" );;
-   current_section = data->head_section;
+   current_section = new_section( "" );
+   add_section( data, current_section );
 
    /// Open file for reading, check for errors
-   fp = fopen( filename, "r" );
+   fp = fopen( filename, "rb" );
    if( fp == NULL ){
       snprintf( error_message, INI_READER_STRLEN, "failed to open: %s", filename );
       set_last_error( data, E_INI_READER_FILE_NOT_FOUND, error_message );
       return data;
    }
 
+   /// Read the whole file, keys and plain values are kept in place
+#ifdef INI_READER_CACHE
+   cacheable = cache_directory && fstat( fileno( fp ), &source ) == 0;
+#endif
+   data->buffer = read_file( fp, &size );
+   fclose( fp );
+#ifdef INI_READER_CACHE
+   if( cacheable )
+      source_hash = hash_bytes( data->buffer, size );
+#endif
+   p   = data->buffer;
+   end = data->buffer + size;
+
    /// Parse the config file
-   while( fgets( line, INI_READER_STRLEN, fp ) != NULL ){
+   while( p < end ){
       // increase line counter
       line_number++;
 
-      // remove whitespace from the beginning and end of the line
-      trim_edge_whitespace( line );
-
-      // section
-      if( line[0] == '[' && line[strlen(line)-1] == ']' ){
-         // remove section delimiters ( '[', ']' )
-         char *name = line+1;
-         name[strlen(name)-1] = '\0';
+      // locate the line, ignore whitespace at its beginning and end
+      eol = memchr( p, '\n', end - p );
+      if( !eol )
+         eol = end;
+      next = eol < end ? eol+1 : end;
+      start = p;
+      while( start < eol && is_blank(*start) )
+         start++;
+      stop = eol;
+      while( stop > start && isspace( (unsigned char)stop[-1] ) )
+         stop--;
+
+      // skip empty lines and comments
+      if( start == stop || *start == ';' || *start == '#' ){
+         p = next;
+         continue;
+      }
 
-         // refuse duplicate sections
-         if( get_section( data, name ) ){
-            snprintf( error_message, INI_READER_STRLEN, "%s, line %d: Duplicate section defined.", filename, line_number );
-            set_last_error( data, E_INI_READER_DUPLICATE_SECTION, error_message );
-            return data;
+      // section, optionally followed by a comment
+      if( *start == '[' ){
+         char *name = start+1;
+         char *close = stop[-1] == ']' ? stop-1 : memchr( name, ']', stop - name );
+         char *rest = close ? close+1 : stop;
+
+         while( rest < stop && is_blank(*rest) )
+            rest++;
+         if( close && (rest == stop || *rest == ';' || *rest == '#') ){
+            // remove section delimiters ( '[', ']' )
+            *close = '\0';
+
+            // refuse duplicate sections
+            if( get_section( data, name ) ){
+               snprintf( error_message, INI_READER_STRLEN, "%s, line %d: Duplicate section defined.", filename, line_number );
+               set_last_error( data, E_INI_READER_DUPLICATE_SECTION, error_message );
+               return data;
+            }
+
+            // add new section, set as current
+            current_section = new_section( name );
+            current_section->line = line_number;
+            add_section( data, current_section );
          }
 
-         // add new section, set as current
-         current_section = new_section( name );
-         add_section( data, current_section );
-
+         p = next;
          continue;
       }
 
       // if line begins with a number or a letter, read a property
-      if( isalnum(line[0]) ){
+      if( isalnum( (unsigned char)*start ) ){
          // look for the '=' sign
-         char *eq = strchr( line, '=' );
+         eq = memchr( start, '=', stop - start );
 
          // check if proper assignment
          if( !eq ){
@@ -295,27 +1241,54 @@ ini_reader_data ini_reader_parse
             return data;
          }
 
+         // decode value, copy it only if it differs from the source
+         if( decode_value( eq+1, end, start - p, NULL, &decoded ) != 0 ){
+            snprintf( error_message, INI_READER_STRLEN, "%s, line %d: %s", filename, line_number, decoded.error );
+            set_last_error( data, E_INI_READER_PARSE_FAIL, error_message );
+            return data;
+         }
+         if( decoded.copy ){
+            value = (char *)malloc( decoded.size + 1 );
+            decode_value( eq+1, end, start - p, value, &decoded );
+         } else {
+            value = (char *)decoded.start;
+         }
+         value[decoded.length] = '\0';
+
          // extract key
+         while( eq > start && isspace( (unsigned char)eq[-1] ) )
+            eq--;
          *eq = '\0';
-         strncpy_fixed( key, line, INI_READER_STRLEN );
-         trim_edge_whitespace( key );
-
-         // extract value
-         strncpy_fixed( value, eq+1, INI_READER_STRLEN );
-         trim_edge_whitespace( value );
 
          // refuse duplicate properties in a section
-         if( get_property( current_section, key ) ){
-            sprintf( error_message, "%s, line %d: Duplicate property key defined.", filename, line_number );
+         if( get_property( current_section, start ) ){
+            if( decoded.copy )
+               free( value );
+            snprintf( error_message, INI_READER_STRLEN, "%s, line %d: Duplicate property key defined.", filename, line_number );
             set_last_error( data, E_INI_READER_DUPLICATE_PROPERTY, error_message );
             return data;
          }
 
          // add new property
-         add_property( current_section, new_property( key, value ) );
+         property = new_property( start, value, decoded.copy );
+         property->line = line_number;
+         add_property( current_section, property );
+
+         line_number += decoded.lines - 1;
+         p = (char *)decoded.next;
+         continue;
       }
+
+      p = next;
    }
 
+#ifdef INI_READER_CACHE
+   /// Store parsed data for the next parse of the same file
+   if( cacheable )
+      write_cached_image( data, &source, source_hash );
+#endif
+
+   expand_references( data );
    return data;
 }
 
@@ -323,16 +1296,207 @@ void ini_reader_free
   ( ini_reader_data ini_data
 ){
    clear_sections( ini_data );
+   free( ini_data->buffer );
+#ifdef INI_READER_CACHE
+   if( ini_data->image )
+      munmap( ini_data->image, ini_data->image_size );
+#endif
+   free( ini_data->filename );
    free( ini_data );
 }
 
+ini_reader_error_code ini_reader_reload
+   ( ini_reader_data ini_data
+){
+   ini_reader_data fresh;
+   struct _ini_reader_data swap;
+
+   // parse again, keep current data if that fails
+   fresh = ini_reader_parse( ini_data->filename );
+   if( fresh->last_error_code != E_INI_READER_SUCCESS ){
+      set_last_error( ini_data, fresh->last_error_code, fresh->last_error_details );
+      ini_reader_free( fresh );
+      return ini_data->last_error_code;
+   }
+
+   // swap parsed contents, old ones (with memoized expansions) are freed with fresh
+   swap = *ini_data;
+   *ini_data = *fresh;
+   *fresh = swap;
+   ini_reader_free( fresh );
+
+   set_last_error( ini_data, E_INI_READER_SUCCESS, "" );
+   return E_INI_READER_SUCCESS;
+}
+
+void expand_references
+   ( ini_reader_data ini_data
+){
+   t_ini_reader_section  s;
+   t_ini_reader_property p;
+
+   // expand everything before the data is shared, lookups never modify it
+   for( s = ini_data->head_section; s; s = s->next ){
+      for( p = s->properties; p; p = p->next ){
+         if( p->expansion == EXPANSION_PENDING )
+            resolve_value( ini_data, s, p );
+      }
+   }
+
+   // failures are reported when the property is read
+   set_last_error( ini_data, E_INI_READER_SUCCESS, "" );
+}
+
+const char *resolve_value
+   ( ini_reader_data         ini_data
+   , t_ini_reader_section    section
+   , t_ini_reader_property   property
+){
+   char *expanded;
+   char error_message[INI_READER_STRLEN];
+
+   switch( property->expansion ){
+   case EXPANSION_DONE:
+      return property->expanded ? property->expanded : property->value;
+   case EXPANSION_FAILED:
+      set_last_error( ini_data, property->expansion_error, property->expanded );
+      return NULL;
+   case EXPANSION_ACTIVE:
+      snprintf( error_message, INI_READER_STRLEN, "[%s] %s: reference cycle", section->key, property->key );
+      set_last_error( ini_data, E_INI_READER_REFERENCE_CYCLE, error_message );
+      return NULL;
+   default:
+      break;
+   }
+
+   // expand once and memoize, along with failures,
+   // only reached from expand_references() while parsing
+   property->expansion = EXPANSION_ACTIVE;
+   expanded = expand_value( ini_data, section, property );
+   if( !expanded ){
+      property->expansion_error = ini_data->last_error_code;
+      property->expanded = copy_string( ini_data->last_error_details );
+      property->expansion = EXPANSION_FAILED;
+      return NULL;
+   }
+   property->expanded = expanded;
+   property->expansion = EXPANSION_DONE;
+
+   return expanded;
+}
+
+char *expand_value
+   ( ini_reader_data         ini_data
+   , t_ini_reader_section    section
+   , t_ini_reader_property   property
+){
+   const char *p = property->value;
+   const char *close;
+   const char *resolved;
+   size_t length = 0;
+   size_t capacity = strlen( p ) + 1;
+   char *out = (char *)malloc( capacity );
+   char *name, *colon;
+   t_ini_reader_section  s;
+   t_ini_reader_property r;
+   char error_message[INI_READER_STRLEN];
+
+   out[0] = '\0';
+   while( *p ){
+      // "$${" stands for a literal "${"
+      if( p[0] == '$' && p[1] == '$' && p[2] == '{' ){
+         append_string( &out, &length, &capacity, "${", 2 );
+         p += 3;
+         continue;
+      }
+      if( p[0] != '$' || p[1] != '{' ){
+         append_string( &out, &length, &capacity, p, 1 );
+         p++;
+         continue;
+      }
+
+      // reference, "${env:name}", "${section:key}" or "${key}" in the same section
+      close = strchr( p+2, '}' );
+      if( !close ){
+         snprintf( error_message, INI_READER_STRLEN, "[%s] %s: unterminated reference", section->key, property->key );
+         set_last_error( ini_data, E_INI_READER_REFERENCE_NOT_FOUND, error_message );
+         free( out );
+         return NULL;
+      }
+      name = (char *)malloc( close - p - 1 );
+      memcpy( name, p+2, close - p - 2 );
+      name[close - p - 2] = '\0';
+      colon = strchr( name, ':' );
+
+      if( colon ){
+         *colon = '\0';
+         s = get_section( ini_data, name );
+         *colon = ':';
+      } else {
+         s = section;
+      }
+      r = s ? get_property( s, colon ? colon+1 : name ) : NULL;
+
+      if( r ){
+         resolved = resolve_value( ini_data, s, r );
+
+         // nested failure, error already set
+         if( !resolved ){
+            free( name );
+            free( out );
+            return NULL;
+         }
+      } else if( colon && colon - name == 3 && strncmp( name, "env", 3 ) == 0 ){
+         // not defined in an [env] section, use the environment
+         resolved = getenv( colon+1 );
+      } else {
+         resolved = NULL;
+      }
+
+      if( !resolved ){
+         snprintf( error_message, INI_READER_STRLEN, "[%s] %s: reference ${%s} not found", section->key, property->key, name );
+         set_last_error( ini_data, E_INI_READER_REFERENCE_NOT_FOUND, error_message );
+         free( name );
+         free( out );
+         return NULL;
+      }
+
+      append_string( &out, &length, &capacity, resolved, strlen( resolved ) );
+      free( name );
+      p = close+1;
+   }
+
+   return out;
+}
+
 const char *ini_reader_get_basic
    ( ini_reader_data    ini_data
    , const char        *section
    , const char        *key
+){
+#ifdef INI_READER_PROFILE
+   struct timespec start, stop;
+   const char *value;
+
+   clock_gettime( CLOCK_MONOTONIC, &start );
+   value = lookup_value( ini_data, section, key );
+   clock_gettime( CLOCK_MONOTONIC, &stop );
+   profile_record( section, key, value == NULL, &start, &stop );
+
+   return value;
+#else
+   return lookup_value( ini_data, section, key );
+#endif
+}
+
+const char *lookup_value
+   ( ini_reader_data    ini_data
+   , const char        *section
+   , const char        *key
 ){
    t_ini_reader_section  s;
    t_ini_reader_property p;
+   const char *value;
    char error_message[INI_READER_STRLEN];
 
    // locate section, return NULL if not found
@@ -351,9 +1515,11 @@ const char *ini_reader_get_basic
       return NULL;
    }
 
-   // property found, return value
-   set_last_error( ini_data, E_INI_READER_SUCCESS, "" );
-   return p->value;
+   // property found, expand references, return value
+   value = resolve_value( ini_data, s, p );
+   if( value )
+      set_last_error( ini_data, E_INI_READER_SUCCESS, "" );
+   return value;
 }
 
 const char *ini_reader_get_string
@@ -419,6 +1585,581 @@ double ini_reader_get_double
    return atof( val_str );
 }
 
+int compare_plan_entries
+   ( const void *a
+   , const void *b
+){
+   const ini_reader_schema_entry *ea = &((const struct _t_ini_reader_plan_entry *)a)->entry;
+   const ini_reader_schema_entry *eb = &((const struct _t_ini_reader_plan_entry *)b)->entry;
+   int cmp = strcmp( ea->section, eb->section );
+
+   if( cmp != 0 )
+      return cmp;
+   return strcmp( ea->key, eb->key );
+}
+
+t_ini_reader_plan_section find_plan_section
+   ( ini_reader_schema  schema
+   , const char        *name
+){
+   size_t low  = 0;
+   size_t high = schema->section_count;
+
+   // binary search through sorted section names
+   while( low < high ){
+      size_t mid = low + (high-low)/2;
+      int cmp = strcmp( name, schema->sections[mid].name );
+      if( cmp == 0 )
+         return &schema->sections[mid];
+      if( cmp < 0 )
+         high = mid;
+      else
+         low = mid+1;
+   }
+
+   return NULL;
+}
+
+t_ini_reader_plan_entry find_plan_entry
+   ( ini_reader_schema           schema
+   , t_ini_reader_plan_section   section
+   , const char                 *key
+){
+   size_t low  = section->first;
+   size_t high = section->first + section->count;
+
+   // binary search through sorted keys of the section
+   while( low < high ){
+      size_t mid = low + (high-low)/2;
+      int cmp = strcmp( key, schema->entries[mid].entry.key );
+      if( cmp == 0 )
+         return &schema->entries[mid];
+      if( cmp < 0 )
+         high = mid;
+      else
+         low = mid+1;
+   }
+
+   return NULL;
+}
+
+int convert_value
+   ( const char        *str
+   , ini_reader_type    type
+   , int               *int_value
+   , double            *double_value
+){
+   char *end;
+   long  l;
+   double d;
+
+   switch( type ){
+   case INI_READER_TYPE_INT:
+      errno = 0;
+      l = strtol( str, &end, 10 );
+      if( end == str || *end != '\0' || errno == ERANGE || l < INT_MIN || l > INT_MAX )
+         return -1;
+      *int_value    = (int)l;
+      *double_value = (double)l;
+      return 0;
+   case INI_READER_TYPE_DOUBLE:
+      errno = 0;
+      d = strtod( str, &end );
+      if( end == str || *end != '\0' || errno == ERANGE || isnan( d ) )
+         return -1;
+      *double_value = d;
+      return 0;
+   default:
+      // ranges of strings apply to their length
+      *double_value = (double)strlen( str );
+      return 0;
+   }
+}
+
+void store_value
+   ( void                     *target
+   , t_ini_reader_plan_entry   plan_entry
+   , const char               *str
+   , int                       int_value
+   , double                    double_value
+){
+   char *member = (char *)target + plan_entry->entry.offset;
+
+   switch( plan_entry->entry.type ){
+   case INI_READER_TYPE_INT:
+      *(int *)member = int_value;
+      break;
+   case INI_READER_TYPE_DOUBLE:
+      *(double *)member = double_value;
+      break;
+   default:
+      *(const char **)member = str;
+      break;
+   }
+}
+
+void report_violation
+   ( ini_reader_data   ini_data
+   , FILE             *report
+   , char             *first
+   , int               violations
+   , int               line
+   , const char       *message
+){
+   char error_message[INI_READER_STRLEN];
+
+   if( line > 0 )
+      snprintf( error_message, INI_READER_STRLEN, "%s:%d: %s", ini_data->filename, line, message );
+   else
+      snprintf( error_message, INI_READER_STRLEN, "%s: %s", ini_data->filename, message );
+
+   // keep the first violation for error details, print all of them to report
+   if( violations == 0 )
+      strncpy_fixed( first, error_message, INI_READER_STRLEN );
+   if( report )
+      fprintf( report, "%s\n", error_message );
+}
+
+ini_reader_schema ini_reader_schema_compile
+   ( const ini_reader_schema_entry *entries
+   , size_t                         count
+){
+   ini_reader_schema schema;
+   size_t i;
+
+   schema = (ini_reader_schema)malloc( sizeof(*schema) );
+   schema->entries  = (t_ini_reader_plan_entry)malloc( (count ? count : 1) * sizeof(*schema->entries) );
+   schema->sections = (t_ini_reader_plan_section)malloc( (count ? count : 1) * sizeof(*schema->sections) );
+   schema->entry_count   = count;
+   schema->section_count = 0;
+
+   /// Copy entries, check them and convert default values
+   for( i = 0; i < count; i++ ){
+      t_ini_reader_plan_entry pe = &schema->entries[i];
+      pe->entry = entries[i];
+      pe->default_int    = 0;
+      pe->default_double = 0.0;
+
+      if( !pe->entry.section || !pe->entry.key )
+         goto invalid;
+      if( pe->entry.type < INI_READER_TYPE_STRING || pe->entry.type > INI_READER_TYPE_DOUBLE )
+         goto invalid;
+      if( (pe->entry.flags & INI_READER_RANGE) && pe->entry.min > pe->entry.max )
+         goto invalid;
+      if( pe->entry.default_value ){
+         if( convert_value( pe->entry.default_value, pe->entry.type
+                          , &pe->default_int, &pe->default_double ) != 0 )
+            goto invalid;
+         if( (pe->entry.flags & INI_READER_RANGE)
+          && (pe->default_double < pe->entry.min || pe->default_double > pe->entry.max) )
+            goto invalid;
+      }
+   }
+
+   /// Sort entries, refuse duplicates
+   qsort( schema->entries, count, sizeof(*schema->entries), compare_plan_entries );
+   for( i = 1; i < count; i++ ){
+      if( compare_plan_entries( &schema->entries[i-1], &schema->entries[i] ) == 0 )
+         goto invalid;
+   }
+
+   /// Group entries by section
+   for( i = 0; i < count; i++ ){
+      const char *name = schema->entries[i].entry.section;
+      t_ini_reader_plan_section last = schema->section_count
+                                     ? &schema->sections[schema->section_count-1] : NULL;
+      if( last && strcmp( last->name, name ) == 0 ){
+         last->count++;
+      } else {
+         last = &schema->sections[schema->section_count++];
+         last->name  = name;
+         last->first = i;
+         last->count = 1;
+      }
+   }
+
+   return schema;
+
+invalid:
+   ini_reader_schema_free( schema );
+   return NULL;
+}
+
+void ini_reader_schema_free
+   ( ini_reader_schema schema
+){
+   if( !schema )
+      return;
+   free( schema->entries );
+   free( schema->sections );
+   free( schema );
+}
+
+int ini_reader_bind
+   ( ini_reader_data     ini_data
+   , ini_reader_schema   schema
+   , void               *target
+   , FILE               *report
+){
+   t_ini_reader_section       s;
+   t_ini_reader_property      p;
+   t_ini_reader_plan_section  ps;
+   t_ini_reader_plan_entry    pe;
+   const char *value;
+   char *seen;
+   int violations = 0;
+   int int_value;
+   double double_value;
+   char message[INI_READER_STRLEN];
+   char first[INI_READER_STRLEN];
+
+   // compiling the schema failed, nothing can be validated
+   if( !schema ){
+      report_violation( ini_data, report, first, violations++, 0, "no schema to bind to" );
+      set_last_error( ini_data, E_INI_READER_SCHEMA_VIOLATION, first );
+      return violations;
+   }
+
+   seen = (char *)calloc( schema->entry_count ? schema->entry_count : 1, 1 );
+
+   /// Single pass through config data, sections not in the schema are skipped
+   for( s = ini_data->head_section; s; s = s->next ){
+      ps = find_plan_section( schema, s->key );
+      if( !ps )
+         continue;
+
+      for( p = s->properties; p; p = p->next ){
+         pe = find_plan_entry( schema, ps, p->key );
+         if( !pe ){
+            snprintf( message, INI_READER_STRLEN, "[%s] %s: unknown property", s->key, p->key );
+            report_violation( ini_data, report, first, violations++, p->line, message );
+            continue;
+         }
+         seen[pe - schema->entries] = 1;
+
+         value = resolve_value( ini_data, s, p );
+         if( !value ){
+            report_violation( ini_data, report, first, violations++, p->line, ini_data->last_error_details );
+            continue;
+         }
+
+         if( convert_value( value, pe->entry.type, &int_value, &double_value ) != 0 ){
+            snprintf( message, INI_READER_STRLEN, "[%s] %s: '%s' is not a valid %s"
+                    , s->key, p->key, value
+                    , pe->entry.type == INI_READER_TYPE_INT ? "integer" : "number" );
+            report_violation( ini_data, report, first, violations++, p->line, message );
+            continue;
+         }
+
+         if( (pe->entry.flags & INI_READER_RANGE)
+          && (double_value < pe->entry.min || double_value > pe->entry.max) ){
+            snprintf( message, INI_READER_STRLEN, "[%s] %s: '%s' is out of range [%g, %g]"
+                    , s->key, p->key, value, pe->entry.min, pe->entry.max );
+            report_violation( ini_data, report, first, violations++, p->line, message );
+            continue;
+         }
+
+         store_value( target, pe, value, int_value, double_value );
+      }
+   }
+
+   /// Check for missing properties, fill in defaults
+   for( size_t i = 0; i < schema->entry_count; i++ ){
+      if( seen[i] )
+         continue;
+      pe = &schema->entries[i];
+
+      if( pe->entry.flags & INI_READER_REQUIRED ){
+         s = get_section( ini_data, pe->entry.section );
+         snprintf( message, INI_READER_STRLEN, "[%s] %s: missing required property"
+                 , pe->entry.section, pe->entry.key );
+         report_violation( ini_data, report, first, violations++, s ? s->line : 0, message );
+      } else if( pe->entry.default_value ){
+         store_value( target, pe, pe->entry.default_value, pe->default_int, pe->default_double );
+      }
+   }
+
+   free( seen );
+   if( violations )
+      set_last_error( ini_data, E_INI_READER_SCHEMA_VIOLATION, first );
+   else
+      set_last_error( ini_data, E_INI_READER_SUCCESS, "" );
+   return violations;
+}
+
+#ifdef INI_READER_PROFILE
+unsigned long profile_hash
+   ( const char *section
+   , const char *key
+){
+   // FNV-1a over section and key, separated by '\0'
+   unsigned long hash = 2166136261UL;
+
+   while( *section )
+      hash = (hash ^ (unsigned char)*section++) * 16777619UL;
+   hash = (hash ^ 0) * 16777619UL;
+   while( *key )
+      hash = (hash ^ (unsigned char)*key++) * 16777619UL;
+
+   return hash;
+}
+
+void profile_create_thread_key
+   ( void
+){
+   pthread_key_create( &profile_thread_key, profile_release_thread_buffer );
+}
+
+void profile_release_thread_buffer
+   ( void *buffer
+){
+   // counters stay in the reports, the next new thread continues with them
+   __atomic_store_n( &((t_ini_reader_profile_buffer)buffer)->in_use, 0, __ATOMIC_RELEASE );
+}
+
+t_ini_reader_profile_buffer profile_get_thread_buffer
+   ( void
+){
+   t_ini_reader_profile_buffer buffer = profile_thread_buffer;
+   int in_use;
+
+   if( buffer )
+      return buffer;
+
+   // first lookup in this thread, take over the buffer of an exited thread
+   pthread_once( &profile_thread_key_once, profile_create_thread_key );
+   for( buffer = __atomic_load_n( &profile_buffers, __ATOMIC_ACQUIRE ); buffer; buffer = buffer->next ){
+      in_use = 0;
+      if( __atomic_compare_exchange_n( &buffer->in_use, &in_use, 1
+                                     , 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+         break;
+   }
+
+   // none free, publish a new buffer without locking
+   if( !buffer ){
+      buffer = (t_ini_reader_profile_buffer)calloc( 1, sizeof(*buffer) );
+      buffer->in_use = 1;
+      buffer->epoch = __atomic_load_n( &profile_epoch, __ATOMIC_ACQUIRE );
+      buffer->next = __atomic_load_n( &profile_buffers, __ATOMIC_ACQUIRE );
+      while( !__atomic_compare_exchange_n( &profile_buffers, &buffer->next, buffer
+                                         , 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE ) )
+         ;
+   }
+   pthread_setspecific( profile_thread_key, buffer );
+   profile_thread_buffer = buffer;
+
+   return buffer;
+}
+
+void profile_record
+   ( const char               *section
+   , const char               *key
+   , int                       miss
+   , const struct timespec    *start
+   , const struct timespec    *stop
+){
+   t_ini_reader_profile_buffer buffer = profile_get_thread_buffer();
+   t_ini_reader_profile_slot slot;
+   unsigned long hash = profile_hash( section, key );
+   unsigned long epoch = __atomic_load_n( &profile_epoch, __ATOMIC_ACQUIRE );
+   size_t i, index;
+
+   // counters were reset, clear them here so only this thread writes to them
+   if( buffer->epoch != epoch ){
+      for( i = 0; i < INI_READER_PROFILE_SLOTS; i++ ){
+         __atomic_store_n( &buffer->slots[i].accesses, 0, __ATOMIC_RELAXED );
+         __atomic_store_n( &buffer->slots[i].misses, 0, __ATOMIC_RELAXED );
+         __atomic_store_n( &buffer->slots[i].nanoseconds, 0, __ATOMIC_RELAXED );
+      }
+      __atomic_store_n( &buffer->dropped, 0, __ATOMIC_RELAXED );
+      __atomic_store_n( &buffer->epoch, epoch, __ATOMIC_RELEASE );
+   }
+
+   // open addressing, the slot of a pair never changes once it is used
+   for( i = 0; i < INI_READER_PROFILE_SLOTS; i++ ){
+      index = (hash + i) & (INI_READER_PROFILE_SLOTS - 1);
+      slot = &buffer->slots[index];
+
+      if( !slot->used ){
+         slot->section = copy_string( section );
+         slot->key     = copy_string( key );
+         slot->hash    = hash;
+         __atomic_store_n( &slot->used, 1, __ATOMIC_RELEASE );
+         break;
+      }
+      if( slot->hash == hash && strcmp( slot->section, section ) == 0 && strcmp( slot->key, key ) == 0 )
+         break;
+   }
+
+   if( i == INI_READER_PROFILE_SLOTS ){
+      __atomic_store_n( &buffer->dropped, buffer->dropped + 1, __ATOMIC_RELAXED );
+      return;
+   }
+
+   // only this thread writes to the slot, plain increments published atomically
+   __atomic_store_n( &slot->accesses, slot->accesses + 1, __ATOMIC_RELAXED );
+   if( miss )
+      __atomic_store_n( &slot->misses, slot->misses + 1, __ATOMIC_RELAXED );
+   __atomic_store_n( &slot->nanoseconds
+                   , slot->nanoseconds + (unsigned long long)(stop->tv_sec - start->tv_sec) * 1000000000ULL
+                                       + stop->tv_nsec - start->tv_nsec
+                   , __ATOMIC_RELAXED );
+}
+
+int profile_compare_names
+   ( const void *a
+   , const void *b
+){
+   const struct _t_ini_reader_profile_slot *sa = (const struct _t_ini_reader_profile_slot *)a;
+   const struct _t_ini_reader_profile_slot *sb = (const struct _t_ini_reader_profile_slot *)b;
+   int cmp = strcmp( sa->section, sb->section );
+
+   if( cmp != 0 )
+      return cmp;
+   return strcmp( sa->key, sb->key );
+}
+
+int profile_compare_accesses
+   ( const void *a
+   , const void *b
+){
+   const struct _t_ini_reader_profile_slot *sa = (const struct _t_ini_reader_profile_slot *)a;
+   const struct _t_ini_reader_profile_slot *sb = (const struct _t_ini_reader_profile_slot *)b;
+
+   // most accessed first, ties broken by name
+   if( sa->accesses != sb->accesses )
+      return sa->accesses < sb->accesses ? 1 : -1;
+   return profile_compare_names( a, b );
+}
+
+int ini_reader_profile_get
+   ( const char                 *section
+   , const char                 *key
+   , ini_reader_profile_stats   *stats
+){
+   t_ini_reader_profile_buffer buffer;
+   t_ini_reader_profile_slot slot;
+   unsigned long hash = profile_hash( section, key );
+   unsigned long epoch = __atomic_load_n( &profile_epoch, __ATOMIC_ACQUIRE );
+   int found = 0;
+   size_t i;
+
+   stats->accesses    = 0;
+   stats->misses      = 0;
+   stats->nanoseconds = 0;
+
+   // sum counters of all threads
+   for( buffer = __atomic_load_n( &profile_buffers, __ATOMIC_ACQUIRE ); buffer; buffer = buffer->next ){
+      if( __atomic_load_n( &buffer->epoch, __ATOMIC_ACQUIRE ) != epoch )
+         continue;
+      for( i = 0; i < INI_READER_PROFILE_SLOTS; i++ ){
+         slot = &buffer->slots[(hash + i) & (INI_READER_PROFILE_SLOTS - 1)];
+         if( !__atomic_load_n( &slot->used, __ATOMIC_ACQUIRE ) )
+            break;
+         if( slot->hash == hash && strcmp( slot->section, section ) == 0 && strcmp( slot->key, key ) == 0 ){
+            stats->accesses    += __atomic_load_n( &slot->accesses, __ATOMIC_RELAXED );
+            stats->misses      += __atomic_load_n( &slot->misses, __ATOMIC_RELAXED );
+            stats->nanoseconds += __atomic_load_n( &slot->nanoseconds, __ATOMIC_RELAXED );
+            found = 1;
+            break;
+         }
+      }
+   }
+
+   return found ? 0 : -1;
+}
+
+void ini_reader_profile_report
+   ( FILE *fp
+){
+   t_ini_reader_profile_buffer head = __atomic_load_n( &profile_buffers, __ATOMIC_ACQUIRE );
+   unsigned long epoch = __atomic_load_n( &profile_epoch, __ATOMIC_ACQUIRE );
+   t_ini_reader_profile_buffer buffer;
+   t_ini_reader_profile_slot slot;
+   struct _t_ini_reader_profile_slot *merged;
+   size_t count = 0, unique = 0, buffers = 0, i;
+   unsigned long accesses = 0, misses = 0, dropped = 0;
+
+   // buffers of threads started later are added in front of head and skipped
+   for( buffer = head; buffer; buffer = buffer->next )
+      buffers++;
+   merged = (struct _t_ini_reader_profile_slot *)malloc( (buffers ? buffers : 1) * sizeof(buffer->slots) );
+
+   /// Snapshot used slots of all threads
+   for( buffer = head; buffer; buffer = buffer->next ){
+      // not cleared since the last reset, counts as empty
+      if( __atomic_load_n( &buffer->epoch, __ATOMIC_ACQUIRE ) != epoch )
+         continue;
+      dropped += __atomic_load_n( &buffer->dropped, __ATOMIC_RELAXED );
+      for( i = 0; i < INI_READER_PROFILE_SLOTS; i++ ){
+         slot = &buffer->slots[i];
+         if( !__atomic_load_n( &slot->used, __ATOMIC_ACQUIRE ) )
+            continue;
+         merged[count] = *slot;
+         merged[count].accesses    = __atomic_load_n( &slot->accesses, __ATOMIC_RELAXED );
+         merged[count].misses      = __atomic_load_n( &slot->misses, __ATOMIC_RELAXED );
+         merged[count].nanoseconds = __atomic_load_n( &slot->nanoseconds, __ATOMIC_RELAXED );
+         count++;
+      }
+   }
+
+   /// Merge counters of identical pairs, then sort by access count
+   qsort( merged, count, sizeof(*merged), profile_compare_names );
+   for( i = 0; i < count; i++ ){
+      if( unique > 0 && profile_compare_names( &merged[unique-1], &merged[i] ) == 0 ){
+         merged[unique-1].accesses    += merged[i].accesses;
+         merged[unique-1].misses      += merged[i].misses;
+         merged[unique-1].nanoseconds += merged[i].nanoseconds;
+      } else {
+         merged[unique++] = merged[i];
+      }
+   }
+   qsort( merged, unique, sizeof(*merged), profile_compare_accesses );
+
+   /// Print the report
+   for( i = 0; i < unique; i++ ){
+      accesses += merged[i].accesses;
+      misses   += merged[i].misses;
+   }
+   fprintf( fp, "ini-reader profile: %lu lookups, %lu misses, %lu not recorded\n", accesses, misses, dropped );
+   fprintf( fp, "%10s %10s %12s %10s  %s\n", "accesses", "misses", "total us", "avg ns", "property" );
+   for( i = 0; i < unique; i++ ){
+      fprintf( fp, "%10lu %10lu %12.1f %10.0f  [%s] %s\n"
+             , merged[i].accesses, merged[i].misses
+             , merged[i].nanoseconds / 1000.0
+             , merged[i].accesses ? (double)merged[i].nanoseconds / merged[i].accesses : 0.0
+             , merged[i].section, merged[i].key );
+   }
+
+   free( merged );
+}
+
+void profile_report_at_exit
+   ( void
+){
+   if( profile_exit_report )
+      ini_reader_profile_report( profile_exit_report );
+}
+
+void ini_reader_profile_report_at_exit
+   ( FILE *fp
+){
+   // register the handler only once, later calls change the destination
+   if( !profile_exit_registered && fp ){
+      atexit( profile_report_at_exit );
+      profile_exit_registered = 1;
+   }
+   profile_exit_report = fp;
+}
+
+void ini_reader_profile_reset
+   ( void
+){
+   // counters are written only by their own thread, start a new epoch instead
+   __atomic_fetch_add( &profile_epoch, 1, __ATOMIC_ACQ_REL );
+}
+#endif
+
 const char *ini_reader_get_error_description
    ( ini_reader_error_code error_code
 ){
@@ -1,6 +1,9 @@
 #ifndef INI_READER_H_
 #define INI_READER_H_
 
+#include <stddef.h>
+#include <stdio.h>
+
 enum _ini_reader_error_code
    { E_INI_READER_SUCCESS = 0
    , E_INI_READER_FILE_NOT_FOUND = -1
@@ -9,6 +12,9 @@ enum _ini_reader_error_code
    , E_INI_READER_DUPLICATE_PROPERTY = -12
    , E_INI_READER_SECTION_NOT_FOUND = -21
    , E_INI_READER_PROPERTY_NOT_FOUND = -22
+   , E_INI_READER_SCHEMA_VIOLATION = -30
+   , E_INI_READER_REFERENCE_NOT_FOUND = -41
+   , E_INI_READER_REFERENCE_CYCLE = -42
    , E_INI_READER_UNKNOWN = -200
 };
 
@@ -19,6 +25,36 @@ typedef struct _ini_reader_data * ini_reader_data;
 
 // parse configuration file
 ini_reader_data ini_reader_parse( const char *filename );
+// parse the same file again, keeping current data if that fails
+ini_reader_error_code ini_reader_reload( ini_reader_data ini_data );
+
+// parsed-config cache, disabled by default, directory NULL disables it again
+// compiled in only with INI_READER_CACHE defined
+typedef struct _ini_reader_cache_stats {
+   unsigned long  hits;
+   unsigned long  misses;            // includes stale and corrupt images
+   unsigned long  stale;
+   unsigned long  corrupt;
+   unsigned long  writes;
+   unsigned long  write_failures;
+} ini_reader_cache_stats;
+
+#ifdef INI_READER_CACHE
+void ini_reader_set_cache_directory( const char *directory );
+void ini_reader_get_cache_stats( ini_reader_cache_stats *stats );
+#else
+   #define ini_reader_set_cache_directory( directory )    ((void)0)
+static inline void ini_reader_get_cache_stats
+   ( ini_reader_cache_stats *stats
+){
+   stats->hits           = 0;
+   stats->misses         = 0;
+   stats->stale          = 0;
+   stats->corrupt        = 0;
+   stats->writes         = 0;
+   stats->write_failures = 0;
+}
+#endif
 
 // getters for config data
 const char *ini_reader_get_string( ini_reader_data    ini_data
@@ -34,6 +70,83 @@ double ini_reader_get_double( ini_reader_data   ini_data
                             , const char       *key
                             , double            default_value );
 
+// value types known to schemas
+enum _ini_reader_type
+   { INI_READER_TYPE_STRING
+   , INI_READER_TYPE_INT
+   , INI_READER_TYPE_DOUBLE
+};
+
+typedef enum _ini_reader_type ini_reader_type;
+
+// schema entry flags
+#define INI_READER_REQUIRED   0x01  // property must be present
+#define INI_READER_RANGE      0x02  // value (or string length) must be in [min, max]
+
+// description of a single property, bound to a struct member at offset
+typedef struct _ini_reader_schema_entry {
+   const char       *section;
+   const char       *key;
+   ini_reader_type   type;
+   int               flags;
+   double            min;
+   double            max;
+   const char       *default_value;   // used for missing optional properties, may be NULL
+   size_t            offset;          // offsetof() of the target struct member
+} ini_reader_schema_entry;
+
+// compiled schema
+typedef struct _ini_reader_schema * ini_reader_schema;
+
+// compile schema entries into a lookup plan, NULL if entries are inconsistent
+ini_reader_schema ini_reader_schema_compile( const ini_reader_schema_entry *entries
+                                           , size_t                         count );
+void ini_reader_schema_free( ini_reader_schema schema );
+
+// validate config data and store values into target struct,
+// returns number of violations, each one is printed to report (if not NULL)
+int ini_reader_bind( ini_reader_data     ini_data
+                   , ini_reader_schema   schema
+                   , void               *target
+                   , FILE               *report );
+
+// access statistics of a single (section, key) pair, summed over all threads
+typedef struct _ini_reader_profile_stats {
+   unsigned long        accesses;
+   unsigned long        misses;
+   unsigned long long   nanoseconds;
+} ini_reader_profile_stats;
+
+// lookup profiling, compiled in only with INI_READER_PROFILE defined
+#ifdef INI_READER_PROFILE
+// get statistics of a pair, returns -1 if it was not looked up since the last reset
+int ini_reader_profile_get( const char                 *section
+                          , const char                 *key
+                          , ini_reader_profile_stats   *stats );
+// print statistics of all pairs, most accessed first
+void ini_reader_profile_report( FILE *fp );
+// print the report to fp when the program exits, NULL cancels it
+void ini_reader_profile_report_at_exit( FILE *fp );
+// clear all counters, each thread clears its own on its next lookup
+void ini_reader_profile_reset( void );
+#else
+static inline int ini_reader_profile_get
+   ( const char                 *section
+   , const char                 *key
+   , ini_reader_profile_stats   *stats
+){
+   (void)section;
+   (void)key;
+   stats->accesses    = 0;
+   stats->misses      = 0;
+   stats->nanoseconds = 0;
+   return -1;
+}
+   #define ini_reader_profile_report( fp )                ((void)0)
+   #define ini_reader_profile_report_at_exit( fp )        ((void)0)
+   #define ini_reader_profile_reset()                     ((void)0)
+#endif
+
 // bookkeeping
 void ini_reader_free( ini_reader_data ini_data );
 
@@ -1,8 +1,50 @@
+// mkdir(), utimensat(), directory listing and threads are not part of C99
+#if defined(INI_READER_CACHE) || defined(INI_READER_PROFILE)
+   #define _XOPEN_SOURCE 700
+#endif
+
 #include "ini-reader.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
+#ifdef INI_READER_CACHE
+   #include <fcntl.h>
+   #include <unistd.h>
+   #include <dirent.h>
+   #include <sys/stat.h>
+#endif
+#ifdef INI_READER_PROFILE
+   #include <pthread.h>
+#endif
+
+struct test_config {
+   const char *name;
+   int         port;
+   double      ratio;
+   int         retries;
+};
+
+const ini_reader_schema_entry test_schema[] =
+   { { "server", "name",    INI_READER_TYPE_STRING, INI_READER_REQUIRED, 0, 0, NULL, offsetof(struct test_config, name) }
+   , { "server", "port",    INI_READER_TYPE_INT,    INI_READER_REQUIRED | INI_READER_RANGE, 1, 65535, NULL, offsetof(struct test_config, port) }
+   , { "server", "ratio",   INI_READER_TYPE_DOUBLE, INI_READER_RANGE, 0, 1, "0.5", offsetof(struct test_config, ratio) }
+   , { "client", "retries", INI_READER_TYPE_INT,    0, 0, 0, "3", offsetof(struct test_config, retries) }
+};
+
+const ini_reader_schema_entry test_schema_bad_type[] =
+   { { "server", "port", (ini_reader_type)7, 0, 0, 0, NULL, offsetof(struct test_config, port) }
+};
+
+const ini_reader_schema_entry test_schema_nan_default[] =
+   { { "server", "ratio", INI_READER_TYPE_DOUBLE, INI_READER_RANGE, 0, 1, "nan", offsetof(struct test_config, ratio) }
+};
+
+const ini_reader_schema_entry test_schema_duplicate[] =
+   { { "server", "port", INI_READER_TYPE_INT, 0, 0, 0, NULL, offsetof(struct test_config, port) }
+   , { "server", "port", INI_READER_TYPE_INT, 0, 0, 0, NULL, offsetof(struct test_config, port) }
+};
 
 const char *message_success = "\033[32mTest passed\033[0m";
 const char *message_failure = "\033[31mTest failed\033[0m";
@@ -69,11 +111,85 @@ void test_pointer
    }
 }
 
+#ifdef INI_READER_CACHE
+// run action on every regular file in directory
+void for_each_file
+   ( const char  *directory
+   , void       (*action)( const char *path )
+){
+   DIR *dir = opendir( directory );
+   struct dirent *entry;
+   char path[1024];
+
+   if( dir == NULL )
+      return;
+   while( (entry = readdir( dir )) != NULL ){
+      if( entry->d_name[0] == '.' )
+         continue;
+      snprintf( path, sizeof(path), "%s/%s", directory, entry->d_name );
+      action( path );
+   }
+   closedir( dir );
+}
+
+void remove_file
+   ( const char *path
+){
+   unlink( path );
+}
+
+void corrupt_file
+   ( const char *path
+){
+   // flip the last byte, it belongs to the image strings
+   FILE *fp = fopen( path, "r+b" );
+   int c;
+
+   if( fp == NULL )
+      return;
+   fseek( fp, -1, SEEK_END );
+   c = fgetc( fp );
+   fseek( fp, -1, SEEK_END );
+   fputc( c ^ 0x55, fp );
+   fclose( fp );
+}
+#endif
+
+#ifdef INI_READER_PROFILE
+// one lookup from a short-lived thread
+void *profile_lookup_thread
+   ( void *ini
+){
+   ini_reader_get_int( (ini_reader_data)ini, "types", "integer value", -1 );
+   return NULL;
+}
+#endif
+
 int main( void ){
    const char *test_file = "test.ini";
    const char *test_file_repeat = "test_repeat.ini";
    const char *test_file_missing = "test_non_existent.ini";
+   const char *test_file_syntax = "test_syntax.ini";
+   const char *test_file_unterminated = "test_unterminated.ini";
+   const char *test_file_references = "test_references.ini";
+   const char *test_file_schema = "test_schema.ini";
+   const char *test_file_schema_bad = "test_schema_bad.ini";
    ini_reader_data ini;
+   ini_reader_schema schema;
+   struct test_config config;
+   char long_value[1024];
+   const char *memoized;
+   ini_reader_cache_stats cache;
+#ifdef INI_READER_CACHE
+   const char *test_cache_directory = "test-cache";
+   struct stat source;
+   struct timespec times[2];
+#endif
+   ini_reader_profile_stats stats;
+#ifdef INI_READER_PROFILE
+   pthread_t thread;
+   int i;
+#endif
    FILE *fp;
    
    fp = fopen( test_file, "w" );
@@ -112,6 +228,92 @@ int main( void ){
    fprintf( fp, "[repeat section]\n" );
    fclose( fp );
 
+   memset( long_value, 'x', sizeof(long_value)-1 );
+   long_value[sizeof(long_value)-1] = '\0';
+
+   fp = fopen( test_file_syntax, "w" );
+   if( fp == NULL ){
+      fprintf( stderr, "Error opening config file." );
+      exit( EXIT_FAILURE );
+   }
+   fprintf( fp, "; comment line\n" );
+   fprintf( fp, "# another comment line\n" );
+   fprintf( fp, "[syntax] ; section comment\n" );
+   fprintf( fp, "quoted = \"  spaced ; not a comment  \"  ; comment\n" );
+   fprintf( fp, "escaped = not\\; a comment\n" );
+   fprintf( fp, "escaped quoted = \"tab\\there\"\n" );
+   fprintf( fp, "escaped quote = \"say \\\"hi\\\"\"\n" );
+   fprintf( fp, "inline comment = 7 # seven\n" );
+   fprintf( fp, "hash inside = a#b;c\n" );
+   fprintf( fp, "continued = first \\\n" );
+   fprintf( fp, "            second\n" );
+   fprintf( fp, "block =\n" );
+   fprintf( fp, "   line one\n" );
+   fprintf( fp, "   ; skipped\n" );
+   fprintf( fp, "   line two  \n" );
+   fprintf( fp, "after block = 5\n" );
+   fprintf( fp, "long = %s\n", long_value );
+   fprintf( fp, "path = C:\\path\\new\n" );
+   fprintf( fp, "empty =\n" );
+   fprintf( fp, "   other = 1\n" );
+   fprintf( fp, "dir = C:\\temp\\\n" );
+   fprintf( fp, "[after continuation]\n" );
+   fprintf( fp, "k = 1\n" );
+   fclose( fp );
+
+   fp = fopen( test_file_unterminated, "w" );
+   if( fp == NULL ){
+      fprintf( stderr, "Error opening config file." );
+      exit( EXIT_FAILURE );
+   }
+   fprintf( fp, "key = \"open\n" );
+   fclose( fp );
+
+   fp = fopen( test_file_references, "w" );
+   if( fp == NULL ){
+      fprintf( stderr, "Error opening config file." );
+      exit( EXIT_FAILURE );
+   }
+   fprintf( fp, "[database]\n" );
+   fprintf( fp, "host = localhost\n" );
+   fprintf( fp, "port = 5432\n" );
+   fprintf( fp, "[service]\n" );
+   fprintf( fp, "url = ${database:host}:${database:port}/${name}\n" );
+   fprintf( fp, "name = orders\n" );
+   fprintf( fp, "path = ${env:PATH}\n" );
+   fprintf( fp, "shadowed = ${env:HOME}\n" );
+   fprintf( fp, "literal = $${name}\n" );
+   fprintf( fp, "missing = ${database:user}\n" );
+   fprintf( fp, "[cycle]\n" );
+   fprintf( fp, "a = ${b}\n" );
+   fprintf( fp, "b = ${cycle:a}\n" );
+   fprintf( fp, "[env]\n" );
+   fprintf( fp, "HOME = /srv/orders\n" );
+   fclose( fp );
+
+   fp = fopen( test_file_schema, "w" );
+   if( fp == NULL ){
+      fprintf( stderr, "Error opening config file." );
+      exit( EXIT_FAILURE );
+   }
+   fprintf( fp, "[server]\n" );
+   fprintf( fp, "name = alpha\n" );
+   fprintf( fp, "port = 8080\n" );
+   fprintf( fp, "[other]\n" );
+   fprintf( fp, "ignored = yes\n" );
+   fclose( fp );
+
+   fp = fopen( test_file_schema_bad, "w" );
+   if( fp == NULL ){
+      fprintf( stderr, "Error opening config file." );
+      exit( EXIT_FAILURE );
+   }
+   fprintf( fp, "[server]\n" );
+   fprintf( fp, "port = 70000\n" );
+   fprintf( fp, "ratio = nan\n" );
+   fprintf( fp, "typo = 1\n" );
+   fclose( fp );
+
    ini = ini_reader_parse( test_file_missing );
 
    test_int( __LINE__
@@ -249,5 +451,445 @@ int main( void ){
 
    ini_reader_free( ini );
 
+   // quoting, escapes, comments and continuations
+
+   ini = ini_reader_parse( test_file_syntax );
+
+   test_int( __LINE__
+           , "parse syntax file, error code"
+           , (int)ini_reader_get_last_error_code( ini )
+           , (int)E_INI_READER_SUCCESS );
+
+   test_string( __LINE__
+              , "quoted value"
+              , ini_reader_get_string( ini, "syntax", "quoted", "" )
+              , "  spaced ; not a comment  " );
+
+   test_string( __LINE__
+              , "escaped value"
+              , ini_reader_get_string( ini, "syntax", "escaped", "" )
+              , "not; a comment" );
+
+   test_string( __LINE__
+              , "escaped quoted value"
+              , ini_reader_get_string( ini, "syntax", "escaped quoted", "" )
+              , "tab\there" );
+
+   test_string( __LINE__
+              , "escaped quote"
+              , ini_reader_get_string( ini, "syntax", "escaped quote", "" )
+              , "say \"hi\"" );
+
+   test_int( __LINE__
+           , "inline comment"
+           , ini_reader_get_int( ini, "syntax", "inline comment", -1 )
+           , 7 );
+
+   test_string( __LINE__
+              , "comment characters inside value"
+              , ini_reader_get_string( ini, "syntax", "hash inside", "" )
+              , "a#b;c" );
+
+   test_string( __LINE__
+              , "backslash continuation"
+              , ini_reader_get_string( ini, "syntax", "continued", "" )
+              , "first second" );
+
+   test_string( __LINE__
+              , "indented block"
+              , ini_reader_get_string( ini, "syntax", "block", "" )
+              , "line one\nline two" );
+
+   test_int( __LINE__
+           , "property after indented block"
+           , ini_reader_get_int( ini, "syntax", "after block", -1 )
+           , 5 );
+
+   test_string( __LINE__
+              , "long value"
+              , ini_reader_get_string( ini, "syntax", "long", "" )
+              , long_value );
+
+   test_string( __LINE__
+              , "backslashes in plain value"
+              , ini_reader_get_string( ini, "syntax", "path", "" )
+              , "C:\\path\\new" );
+
+   test_string( __LINE__
+              , "empty value before indented property"
+              , ini_reader_get_string( ini, "syntax", "empty", "-" )
+              , "" );
+
+   test_int( __LINE__
+           , "indented property after empty value"
+           , ini_reader_get_int( ini, "syntax", "other", -1 )
+           , 1 );
+
+   test_string( __LINE__
+              , "trailing backslash before section"
+              , ini_reader_get_string( ini, "syntax", "dir", "" )
+              , "C:\\temp\\" );
+
+   test_int( __LINE__
+           , "section after trailing backslash"
+           , ini_reader_get_int( ini, "after continuation", "k", -1 )
+           , 1 );
+
+   ini_reader_free( ini );
+
+   ini = ini_reader_parse( test_file_unterminated );
+
+   test_int( __LINE__
+           , "parse file, unterminated quote"
+           , (int)ini_reader_get_last_error_code( ini )
+           , (int)E_INI_READER_PARSE_FAIL );
+
+   ini_reader_free( ini );
+
+   // references
+
+   ini = ini_reader_parse( test_file_references );
+
+   memoized = ini_reader_get_string( ini, "service", "url", "" );
+   test_string( __LINE__
+              , "section and same-section references"
+              , memoized
+              , "localhost:5432/orders" );
+   test_pointer( __LINE__
+               , "memoized expansion"
+               , (void *)ini_reader_get_string( ini, "service", "url", "" )
+               , (void *)memoized );
+
+   test_string( __LINE__
+              , "environment reference"
+              , ini_reader_get_string( ini, "service", "path", "" )
+              , getenv( "PATH" ) ? getenv( "PATH" ) : "" );
+
+   test_string( __LINE__
+              , "escaped reference"
+              , ini_reader_get_string( ini, "service", "literal", "" )
+              , "${name}" );
+
+   test_string( __LINE__
+              , "missing reference"
+              , ini_reader_get_string( ini, "service", "missing", "default" )
+              , "default" );
+   test_int( __LINE__
+           , "missing reference, error code"
+           , (int)ini_reader_get_last_error_code( ini )
+           , (int)E_INI_READER_REFERENCE_NOT_FOUND );
+
+   test_string( __LINE__
+              , "reference cycle"
+              , ini_reader_get_string( ini, "cycle", "a", "default" )
+              , "default" );
+   test_int( __LINE__
+           , "reference cycle, error code"
+           , (int)ini_reader_get_last_error_code( ini )
+           , (int)E_INI_READER_REFERENCE_CYCLE );
+
+   ini_reader_get_string( ini, "cycle", "b", "default" );
+   test_int( __LINE__
+           , "reference cycle, other property, error code"
+           , (int)ini_reader_get_last_error_code( ini )
+           , (int)E_INI_READER_REFERENCE_CYCLE );
+
+   test_string( __LINE__
+              , "environment reference defined in [env] section"
+              , ini_reader_get_string( ini, "service", "shadowed", "" )
+              , "/srv/orders" );
+
+   fp = fopen( test_file_references, "a" );
+   if( fp == NULL ){
+      fprintf( stderr, "Error opening config file." );
+      exit( EXIT_FAILURE );
+   }
+   fprintf( fp, "[database]\n" );
+   fclose( fp );
+
+   test_int( __LINE__
+           , "reload invalid file, error code"
+           , (int)ini_reader_reload( ini )
+           , (int)E_INI_READER_DUPLICATE_SECTION );
+   test_string( __LINE__
+              , "reload invalid file, old data kept"
+              , ini_reader_get_string( ini, "service", "url", "" )
+              , "localhost:5432/orders" );
+
+   fp = fopen( test_file_references, "w" );
+   if( fp == NULL ){
+      fprintf( stderr, "Error opening config file." );
+      exit( EXIT_FAILURE );
+   }
+   fprintf( fp, "[database]\n" );
+   fprintf( fp, "host = db.example\n" );
+   fprintf( fp, "port = 6432\n" );
+   fprintf( fp, "[service]\n" );
+   fprintf( fp, "url = ${database:host}:${database:port}\n" );
+   fclose( fp );
+
+   test_int( __LINE__
+           , "reload, error code"
+           , (int)ini_reader_reload( ini )
+           , (int)E_INI_READER_SUCCESS );
+   test_string( __LINE__
+              , "reload, expansion invalidated"
+              , ini_reader_get_string( ini, "service", "url", "" )
+              , "db.example:6432" );
+
+   ini_reader_free( ini );
+
+   // schema binding
+
+   test_pointer( __LINE__
+               , "compile schema with duplicate entries"
+               , ini_reader_schema_compile( test_schema_duplicate, 2 )
+               , NULL );
+
+   test_pointer( __LINE__
+               , "compile schema with NaN default"
+               , ini_reader_schema_compile( test_schema_nan_default, 1 )
+               , NULL );
+
+   test_pointer( __LINE__
+               , "compile schema with unknown type"
+               , ini_reader_schema_compile( test_schema_bad_type, 1 )
+               , NULL );
+
+   schema = ini_reader_schema_compile( test_schema, sizeof(test_schema)/sizeof(test_schema[0]) );
+   ini = ini_reader_parse( test_file_schema );
+   memset( &config, 0, sizeof(config) );
+
+   test_int( __LINE__
+           , "bind valid config, violations"
+           , ini_reader_bind( ini, schema, &config, NULL )
+           , 0 );
+   test_string( __LINE__
+              , "bind valid config, string"
+              , config.name
+              , "alpha" );
+   test_int( __LINE__
+           , "bind valid config, integer"
+           , config.port
+           , 8080 );
+   test_double( __LINE__
+              , "bind valid config, default double"
+              , config.ratio
+              , 0.5 );
+   test_int( __LINE__
+           , "bind valid config, default in missing section"
+           , config.retries
+           , 3 );
+
+   ini_reader_free( ini );
+
+   ini = ini_reader_parse( test_file_schema_bad );
+
+   test_int( __LINE__
+           , "bind invalid config, violations"
+           , ini_reader_bind( ini, schema, &config, NULL )
+           , 4 );
+   test_int( __LINE__
+           , "bind invalid config, error code"
+           , (int)ini_reader_get_last_error_code( ini )
+           , (int)E_INI_READER_SCHEMA_VIOLATION );
+   test_string( __LINE__
+              , "bind invalid config, error details"
+              , ini_reader_get_last_error_details( ini )
+              , "test_schema_bad.ini:2: [server] port: '70000' is out of range [1, 65535]" );
+
+   ini_reader_free( ini );
+   ini = ini_reader_parse( test_file_schema );
+
+   test_int( __LINE__
+           , "bind without schema, violations"
+           , ini_reader_bind( ini, NULL, &config, NULL )
+           , 1 );
+   test_int( __LINE__
+           , "bind without schema, error code"
+           , (int)ini_reader_get_last_error_code( ini )
+           , (int)E_INI_READER_SCHEMA_VIOLATION );
+
+   ini_reader_free( ini );
+   ini_reader_schema_free( schema );
+
+   // parsed-config cache
+
+#ifdef INI_READER_CACHE
+
+   for_each_file( test_cache_directory, remove_file );
+   mkdir( test_cache_directory, 0755 );
+   ini_reader_set_cache_directory( test_cache_directory );
+
+   ini = ini_reader_parse( test_file_syntax );
+   ini_reader_free( ini );
+   ini_reader_get_cache_stats( &cache );
+
+   test_int( __LINE__
+           , "cache, first parse is a miss"
+           , (int)cache.misses
+           , 1 );
+   test_int( __LINE__
+           , "cache, image written"
+           , (int)cache.writes
+           , 1 );
+
+   ini = ini_reader_parse( "./test_syntax.ini" );
+   ini_reader_get_cache_stats( &cache );
+
+   test_int( __LINE__
+           , "cache, hit through a different path to the same file"
+           , (int)cache.hits
+           , 1 );
+   test_string( __LINE__
+              , "cache hit, quoted value"
+              , ini_reader_get_string( ini, "syntax", "quoted", "" )
+              , "  spaced ; not a comment  " );
+   test_string( __LINE__
+              , "cache hit, indented block"
+              , ini_reader_get_string( ini, "syntax", "block", "" )
+              , "line one\nline two" );
+   test_string( __LINE__
+              , "cache hit, long value"
+              , ini_reader_get_string( ini, "syntax", "long", "" )
+              , long_value );
+
+   ini_reader_free( ini );
+
+   // change contents, keep size and modification time
+   stat( test_file_syntax, &source );
+   fp = fopen( test_file_syntax, "r+" );
+   if( fp == NULL ){
+      fprintf( stderr, "Error opening config file." );
+      exit( EXIT_FAILURE );
+   }
+   fseek( fp, -2, SEEK_END );
+   fprintf( fp, "2" );
+   fclose( fp );
+   times[0] = source.st_atim;
+   times[1] = source.st_mtim;
+   utimensat( AT_FDCWD, test_file_syntax, times, 0 );
+
+   ini = ini_reader_parse( test_file_syntax );
+   ini_reader_get_cache_stats( &cache );
+
+   test_int( __LINE__
+           , "cache, change with preserved mtime is stale"
+           , (int)cache.stale
+           , 1 );
+   test_int( __LINE__
+           , "cache, stale image is replaced"
+           , (int)cache.writes
+           , 2 );
+   test_int( __LINE__
+           , "cache, changed value"
+           , ini_reader_get_int( ini, "after continuation", "k", -1 )
+           , 2 );
+
+   ini_reader_free( ini );
+
+   for_each_file( test_cache_directory, corrupt_file );
+   ini = ini_reader_parse( test_file_syntax );
+   ini_reader_get_cache_stats( &cache );
+
+   test_int( __LINE__
+           , "cache, corrupt image"
+           , (int)cache.corrupt
+           , 1 );
+   test_string( __LINE__
+              , "cache, corrupt image falls back to parsing"
+              , ini_reader_get_string( ini, "syntax", "quoted", "" )
+              , "  spaced ; not a comment  " );
+
+   ini_reader_free( ini );
+   ini_reader_set_cache_directory( NULL );
+   for_each_file( test_cache_directory, remove_file );
+   rmdir( test_cache_directory );
+#else
+   ini_reader_set_cache_directory( "test-cache" );
+   ini = ini_reader_parse( test_file_syntax );
+   ini_reader_get_cache_stats( &cache );
+
+   test_int( __LINE__
+           , "cache disabled, parse"
+           , (int)ini_reader_get_last_error_code( ini )
+           , (int)E_INI_READER_SUCCESS );
+   test_int( __LINE__
+           , "cache disabled, no statistics"
+           , (int)(cache.hits + cache.misses + cache.writes)
+           , 0 );
+
+   ini_reader_free( ini );
+#endif
+
+   // lookup profiling
+
+#ifdef INI_READER_PROFILE
+   ini_reader_profile_reset();
+   ini = ini_reader_parse( test_file );
+   ini_reader_get_int( ini, "types", "integer value", -1 );
+   ini_reader_get_int( ini, "types", "integer value", -1 );
+   ini_reader_get_int( ini, "types", "missing value", -1 );
+
+   test_int( __LINE__
+           , "profile, found pair"
+           , ini_reader_profile_get( "types", "integer value", &stats )
+           , 0 );
+   test_int( __LINE__
+           , "profile, access count"
+           , (int)stats.accesses
+           , 2 );
+   test_int( __LINE__
+           , "profile, miss count"
+           , (int)stats.misses
+           , 0 );
+
+   ini_reader_profile_get( "types", "missing value", &stats );
+   test_int( __LINE__
+           , "profile, missing property"
+           , (int)stats.misses
+           , 1 );
+
+   test_int( __LINE__
+           , "profile, pair never looked up"
+           , ini_reader_profile_get( "types", "never read", &stats )
+           , -1 );
+
+   ini_reader_profile_reset();
+   test_int( __LINE__
+           , "profile, reset"
+           , ini_reader_profile_get( "types", "integer value", &stats )
+           , -1 );
+
+   ini_reader_get_int( ini, "types", "integer value", -1 );
+   ini_reader_profile_get( "types", "integer value", &stats );
+   test_int( __LINE__
+           , "profile, access count after reset"
+           , (int)stats.accesses
+           , 1 );
+
+   // buffers of exited threads are reused, their counters are kept
+   for( i = 0; i < 2; i++ ){
+      pthread_create( &thread, NULL, profile_lookup_thread, ini );
+      pthread_join( thread, NULL );
+   }
+   ini_reader_profile_get( "types", "integer value", &stats );
+   test_int( __LINE__
+           , "profile, lookups of exited threads"
+           , (int)stats.accesses
+           , 3 );
+
+   // cancelled, nothing may be printed at exit
+   ini_reader_profile_report_at_exit( stdout );
+   ini_reader_profile_report_at_exit( NULL );
+
+   ini_reader_free( ini );
+#else
+   test_int( __LINE__
+           , "profile disabled"
+           , ini_reader_profile_get( "types", "integer value", &stats )
+           , -1 );
+#endif
+
    return 0;
 }